@@ -0,0 +1,88 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace web
+{
+    namespace json
+    {
+        class value;
+    }
+}
+
+// Heap allocation accounting. When built with ALLOC_STATS, a replacement global
+// operator new records every allocation against the calling thread and the code
+// region it is currently in. Counters are kept in a cache line aligned slot per
+// thread, so the hook does not contend with other threads.
+//
+// Only two steps are checked to be allocation free once warmed up (see
+// tests/zero_alloc_test.cpp): applying an update to BookAnalytics (ANALYTICS)
+// and formatting and signing an order request string (ORDER_BUILD). A book
+// update or an order as a whole still allocates: cpprest builds a new JSON
+// value per received message and copies each sent one, and websocketpp creates
+// a new message per frame. Those allocations are reported under FEED_RECEIVE,
+// FEED_PARSE, FANOUT and ORDER_SEND.
+class AllocStats
+{
+public:
+    enum class Region : int
+    {
+        OTHER,
+        FEED_RECEIVE,
+        FEED_PARSE,
+        ANALYTICS,
+        FANOUT,
+        ORDER_BUILD,
+        ORDER_SEND,
+        COUNT
+    };
+
+    struct Counters
+    {
+        uint64_t allocations;
+        uint64_t deallocations;
+        uint64_t bytes;
+    };
+
+    // Attributes allocations on the calling thread to a region until destroyed
+    class Scope
+    {
+    public:
+        explicit Scope(Region region);
+        ~Scope();
+
+        // Allocations made by this thread since the scope was entered
+        uint64_t allocations() const;
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Region previous_;
+        uint64_t start_allocations_;
+    };
+
+    static bool enabled();
+
+    // Label the calling thread in reports, the name must outlive the process
+    static void name_thread(const char *name);
+
+    static Counters for_thread();
+    static int thread_count();
+    static Counters for_thread_slot(int slot);
+    static const char *thread_name(int slot); // nullptr if the thread was not named
+    static Counters for_region(Region region);
+    static Counters total();
+    static const char *region_name(Region region);
+
+    // Defined in alloc_stats_json.cpp so the counters themselves do not depend on cpprest
+    static web::json::value to_json();
+
+    // Called by the operator new / delete hook
+    static void record_allocation(std::size_t bytes);
+    static void record_deallocation();
+};
+
+#endif // ALLOC_STATS_H
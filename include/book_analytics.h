@@ -0,0 +1,97 @@
+#ifndef BOOK_ANALYTICS_H
+#define BOOK_ANALYTICS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Derived numbers for one instrument, maintained incrementally from book and trade updates
+class BookAnalytics
+{
+public:
+    enum class Side
+    {
+        Bid,
+        Ask
+    };
+
+    // Bit flags identifying each published metric
+    enum Metric : uint32_t
+    {
+        MID = 1u << 0,
+        SPREAD = 1u << 1,
+        MICROPRICE = 1u << 2,
+        IMBALANCE = 1u << 3,
+        VWAP = 1u << 4,
+        TRADE_FLOW = 1u << 5,
+
+        BOOK_METRICS = MID | SPREAD | MICROPRICE | IMBALANCE,
+        TRADE_METRICS = VWAP | TRADE_FLOW
+    };
+
+    BookAnalytics(std::size_t depth = 10, int64_t trade_window_ms = 60000, std::size_t max_trades = 4096);
+
+    // Replace the top levels of one side (best level first)
+    void apply_snapshot(Side side, const double *prices, const double *amounts, std::size_t count);
+    // Insert, update or (amount == 0) delete a single level
+    void apply_change(Side side, double price, double amount);
+    // Recompute metrics touched by the pending changes, returns the changed Metric flags
+    uint32_t finish_update();
+
+    // Allocate the trade ring, done on the first trade if not called before
+    void reserve_trades();
+    // Add a trade to the rolling window, returns the changed Metric flags
+    uint32_t add_trade(int64_t timestamp_ms, double price, double amount, bool buy);
+    // Drop trades that fell out of the window by now_ms, returns the changed Metric flags
+    uint32_t expire_trades(int64_t now_ms);
+
+    double value(Metric metric) const;
+
+    static const char *metric_name(Metric metric);
+    static uint32_t metric_from_name(const std::string &name);
+
+private:
+    struct Trade
+    {
+        int64_t timestamp_ms;
+        double price;
+        double amount;
+        bool buy;
+    };
+
+    struct Levels
+    {
+        std::vector<double> prices;
+        std::vector<double> amounts;
+        std::size_t dirty_from;
+        double depth_amount;
+    };
+
+    Levels &levels(Side side) { return side == Side::Bid ? bids_ : asks_; }
+    void mark_dirty(Levels &lv, std::size_t index);
+    void evict_trades(int64_t now_ms);
+    void drop_oldest_trade();
+
+    std::size_t depth_;
+    int64_t trade_window_ms_;
+
+    Levels bids_;
+    Levels asks_;
+
+    double mid_;
+    double spread_;
+    double microprice_;
+    double imbalance_;
+
+    // Fixed-capacity ring of trades inside the rolling window, allocated on the first trade
+    std::size_t max_trades_;
+    std::vector<Trade> trades_;
+    std::size_t trade_head_;
+    std::size_t trade_count_;
+    double trade_notional_;
+    double trade_volume_;
+    double trade_flow_;
+};
+
+#endif // BOOK_ANALYTICS_H
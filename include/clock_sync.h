@@ -0,0 +1,53 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <cpprest/json.h>
+
+// Estimates the offset between the local clock and the exchange clock from
+// public/get_time round trips, NTP style: the offset is taken from the sample
+// with the lowest round trip delay among the most recent ones.
+class ClockSync
+{
+public:
+    explicit ClockSync(std::size_t window = 8);
+
+    // Microseconds since the epoch on the local clock
+    static int64_t now_us();
+
+    // Record a round trip. All times are in microseconds: t0 local send, t1 exchange
+    // receive, t2 exchange send, t3 local receive.
+    void add_sample(int64_t t0, int64_t t1, int64_t t2, int64_t t3);
+
+    bool synced() const { return sample_count_ > 0; }
+    int64_t offset_us() const { return offset_us_; } // Exchange clock minus local clock
+    int64_t rtt_us() const { return rtt_us_; }
+    int64_t jitter_us() const { return jitter_us_; }
+    int64_t last_sample_us() const { return last_sample_us_; }
+
+    // Convert an exchange timestamp to the local clock
+    int64_t to_local_us(int64_t exchange_us) const { return exchange_us - offset_us_; }
+
+    web::json::value to_json() const;
+
+private:
+    struct Sample
+    {
+        int64_t offset_us;
+        int64_t rtt_us;
+    };
+
+    std::vector<Sample> samples_; // Ring of the most recent samples
+    std::size_t next_sample_;
+    std::size_t sample_count_;
+    uint64_t total_samples_;
+
+    int64_t offset_us_;
+    int64_t rtt_us_;
+    int64_t jitter_us_;
+    int64_t last_sample_us_;
+};
+
+#endif // CLOCK_SYNC_H
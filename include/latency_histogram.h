@@ -0,0 +1,34 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cpprest/json.h>
+
+// Fixed-bucket latency histogram in microseconds with last/min/max gauges
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(int64_t latency_us);
+
+    uint64_t count() const { return count_; }
+    int64_t last() const { return last_; }
+    double mean() const;
+
+    web::json::value to_json() const;
+
+private:
+    static const std::size_t BUCKET_COUNT = 16;
+    static const int64_t BUCKET_BOUNDS_US[BUCKET_COUNT]; // Upper bounds, the last bucket is open ended
+
+    uint64_t buckets_[BUCKET_COUNT];
+    uint64_t count_;
+    int64_t sum_;
+    int64_t min_;
+    int64_t max_;
+    int64_t last_;
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -2,9 +2,13 @@
 #define ORDER_EXECUTION_H
 
 #include <string>
+#include <spdlog/fmt/fmt.h> // Before cpprest, whose U() macro clashes with fmt templates
 #include <cpprest/http_client.h>
 #include <cpprest/json.h>
 #include "websocket_client.h"
+#include "order_request_builder.h"
+#include "clock_sync.h"
+#include "latency_histogram.h"
 #include <chrono>
 
 class OrderExecution
@@ -14,7 +18,7 @@ public:
 
     web::json::value send_and_receive_request(const std::string &request);
 
-    std::string create_signed_request(const std::string &params, const std::string &request_type);
+    const std::string &create_signed_request(fmt::string_view params, fmt::string_view request_type);
     void place_order(const std::string &instrument_name, double amount, double price, const std::string &order_type, bool market = false);
     void cancel_order(const std::string &order_id);
     void view_open_orders();
@@ -22,6 +26,8 @@ public:
     void modify_order(const std::string &order_id, int amount, double price);
     void subscribe(const std::string &instrument_name);
     void get_order_book(const std::string &instrument_name, int depth = 10);
+    void view_stats();
+    void sync_clock();
 
 private:
     WebSocketClient &deribit_client_;
@@ -29,6 +35,21 @@ private:
     std::string api_key_;
     std::string api_secret_;
     std::string access_token_;
+
+    // Reuses its buffers so building an order does not allocate once warmed up
+    OrderRequestBuilder request_builder_;
+    uint64_t orders_built_;
+
+    // Exchange clock offset and order acknowledgement latency
+    ClockSync clock_sync_;
+    int64_t last_send_us_;
+    int64_t last_receive_us_;
+    LatencyHistogram order_ack_latency_;   // Local send to local receive of the response
+    LatencyHistogram order_ack_one_way_;   // Local send to exchange receive, offset corrected
+    LatencyHistogram exchange_processing_; // Exchange receive to exchange send
+
+    void sync_clock_if_due();
+    void record_ack_latency(const web::json::value &response);
 };
 
 #endif
\ No newline at end of file
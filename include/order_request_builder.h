@@ -0,0 +1,29 @@
+#ifndef ORDER_REQUEST_BUILDER_H
+#define ORDER_REQUEST_BUILDER_H
+
+#include <string>
+#include <spdlog/fmt/fmt.h>
+
+// Builds signed Deribit private requests into reused buffers, so building an
+// order does not allocate once the buffers have grown to their working size.
+// The returned reference stays valid until the next call.
+class OrderRequestBuilder
+{
+public:
+    OrderRequestBuilder(const std::string &api_key, const std::string &api_secret);
+
+    const std::string &place_order(const std::string &instrument_name, double amount, double price, const std::string &direction, bool market);
+    const std::string &cancel_order(const std::string &order_id);
+    const std::string &modify_order(const std::string &order_id, int amount, double price);
+    const std::string &signed_request(fmt::string_view params, fmt::string_view method);
+
+private:
+    std::string api_key_;
+    std::string api_secret_;
+
+    fmt::memory_buffer params_;
+    fmt::memory_buffer method_;
+    std::string request_;
+};
+
+#endif // ORDER_REQUEST_BUILDER_H
@@ -3,6 +3,7 @@
 
 #include <cpprest/ws_client.h>
 #include <cpprest/json.h>
+#include <cstdint>
 #include <string>
 #include <functional>
 
@@ -14,13 +15,19 @@ public:
 
     void connect();
     void send_message(const web::json::value &message);
+    // Send an already serialized message as is
+    void send_raw(const std::string &text);
     void receive_message(std::function<void(const web::json::value &)> callback);
+    // The raw text refers to a buffer reused across messages and is only valid during the callback.
+    // arrival_us is the local receive time (ClockSync::now_us), taken before the body is read and parsed.
+    void receive_message(std::function<void(const web::json::value &, const std::string &, int64_t)> callback);
     void close();
 
 private:
     web::websockets::client::websocket_client client_;
     std::string url_;
     bool is_closed;
+    std::string receive_buffer_;
 };
 
 #endif
\ No newline at end of file
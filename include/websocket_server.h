@@ -3,26 +3,140 @@
 
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
+#ifdef WS_PERMESSAGE_DEFLATE
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+#endif
 #include <set>
+#include <map>
+#include <vector>
+#include <spdlog/fmt/fmt.h> // Before cpprest, whose U() macro clashes with fmt templates
 #include "websocket_client.h"
+#include "book_analytics.h"
+#include "alloc_stats.h"
+#include "clock_sync.h"
+#include "latency_histogram.h"
+
+#ifdef WS_PERMESSAGE_DEFLATE
+// asio config that negotiates permessage-deflate with clients offering it. Each
+// connection keeps its zlib stream across messages (context takeover).
+struct deflate_config : public websocketpp::config::asio
+{
+    typedef deflate_config type;
+    typedef websocketpp::config::asio base;
+
+    struct permessage_deflate_config
+    {
+        typedef base::request_type request_type;
+    };
+
+    // websocketpp calls compress() through this type, so it is wrapped to count the
+    // compressed output. The count is per thread: the frame is compressed inside
+    // send(), so the sender can attribute the difference to the frame it just sent.
+    class permessage_deflate_type
+        : public websocketpp::extensions::permessage_deflate::enabled<permessage_deflate_config>
+    {
+    public:
+        typedef websocketpp::extensions::permessage_deflate::enabled<permessage_deflate_config> base_type;
+
+        websocketpp::lib::error_code compress(std::string const &in, std::string &out)
+        {
+            std::size_t before = out.size();
+            websocketpp::lib::error_code ec = base_type::compress(in, out);
+            compressed_bytes += out.size() - before;
+            return ec;
+        }
+
+        static thread_local uint64_t compressed_bytes;
+    };
+};
+#endif
 
 class WebSocketServer
 {
 public:
-    WebSocketServer();
+    // batch_ms is the default micro-batching window, clients may override it when subscribing.
+    // Book updates older than stale_book_ms by exchange timestamp are dropped, 0 keeps them all.
+    WebSocketServer(uint32_t batch_ms = 0, uint32_t stale_book_ms = 1000);
     void run(uint16_t port);
 
 private:
+#ifdef WS_PERMESSAGE_DEFLATE
+    typedef websocketpp::server<deflate_config> server;
+#else
     typedef websocketpp::server<websocketpp::config::asio> server;
+#endif
+
+    struct Subscription
+    {
+        websocketpp::connection_hdl hdl;
+        uint32_t metrics;                  // BookAnalytics::Metric flags requested by the client
+        std::vector<std::string> channels; // Deribit channels whose raw updates the client receives
+    };
+
+    struct ConnectionState
+    {
+        uint32_t batch_ms;           // Micro-batching window, 0 sends every update as its own frame
+        std::string batch;           // Pending frame holding a JSON array of updates
+        std::size_t batched_updates; // Updates in the pending frame
+        uint64_t batch_generation;   // Bumped on every flush, identifies the batch a timer was armed for
+        bool deflate;                // permessage-deflate negotiated
+    };
 
     server m_server;
     std::set<websocketpp::connection_hdl, std::owner_less<websocketpp::connection_hdl>> connections_;
     WebSocketClient deribit_client_;
     std::mutex mutex_; // Mutex for thread-safe operations
+    std::map<std::string, BookAnalytics> analytics_; // Per-instrument derived metrics, guarded by mutex_
+    std::vector<double> level_prices_;               // Scratch buffers for book snapshots, guarded by mutex_
+    std::vector<double> level_amounts_;
+
+    // Single reader thread fanning Deribit updates out to subscribed clients, started with
+    // the clock sampling thread on the first subscription. The reader exits if the Deribit
+    // connection fails and is started again by the next subscription.
+    bool reader_started_; // Guarded by mutex_
+    bool clock_started_;
+    std::map<std::string, std::vector<Subscription>> subscriptions_; // Keyed by instrument, guarded by mutex_
+    std::string update_instrument_;                                   // Reused per update by the reader thread
+    fmt::memory_buffer frame_buffer_;                                 // Reused for analytics frames
+    uint64_t updates_processed_;
+    uint64_t steady_state_allocations_; // Analytics allocations seen after warm-up
+    uint64_t setup_allocations_;        // First-touch allocations in the current update, not counted above
+
+    // Exchange clock offset and one-way feed delay, guarded by mutex_
+    ClockSync clock_sync_;
+    std::map<int64_t, int64_t> pending_time_requests_; // public/get_time request id -> local send time
+    int64_t next_time_request_id_;
+    std::map<std::string, LatencyHistogram> feed_delay_; // Keyed by channel
+    int64_t stale_book_us_;
+    uint64_t stale_books_;
+
+    // Per-connection batching state and fan-out counters, guarded by mutex_
+    std::map<websocketpp::connection_hdl, ConnectionState, std::owner_less<websocketpp::connection_hdl>> connection_state_;
+    uint32_t default_batch_ms_;
+    uint64_t frames_sent_;
+    uint64_t updates_sent_;
+    uint64_t uncompressed_payload_bytes_; // Before permessage-deflate
+    uint64_t compressed_payload_bytes_;   // As sent, after permessage-deflate where negotiated
+    int64_t fanout_start_us_;             // First frame sent, 0 until then
 
     void on_open(websocketpp::connection_hdl hdl);
     void on_close(websocketpp::connection_hdl hdl);
     void on_message(websocketpp::connection_hdl hdl, server::message_ptr msg);
+
+    void read_updates();
+    void handle_update(const web::json::value &update, const std::string &text, int64_t arrival_us);
+    void sample_clock();
+    bool handle_time_response(const web::json::value &update, int64_t arrival_us);
+    bool record_feed_delay(const web::json::value &update, int64_t arrival_us);
+    web::json::value collect_stats();
+
+    uint32_t update_analytics(const web::json::value &update, std::string &instrument);
+    void publish_analytics(websocketpp::connection_hdl hdl, const std::string &instrument, uint32_t metrics);
+
+    void send_update(websocketpp::connection_hdl hdl, const char *data, std::size_t size);
+    void flush_batch(websocketpp::connection_hdl hdl);
+    void record_frame(const ConnectionState &state, std::size_t updates, std::size_t size, uint64_t compressed_before);
+    void on_batch_timer(websocketpp::connection_hdl hdl, uint64_t batch_generation, websocketpp::lib::error_code const &ec);
 };
 
 #endif // WEBSOCKET_SERVER_H
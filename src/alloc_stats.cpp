@@ -0,0 +1,333 @@
+#include "alloc_stats.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    const int MAX_THREADS = 64;
+    const int REGION_COUNT = static_cast<int>(AllocStats::Region::COUNT);
+
+    struct RegionCounters
+    {
+        std::atomic<uint64_t> allocations;
+        std::atomic<uint64_t> deallocations;
+        std::atomic<uint64_t> bytes;
+    };
+
+    // One cache line aligned slot per thread, written only by its owner. Counters live
+    // in static storage so they are usable before main and never allocate.
+    struct alignas(64) ThreadSlot
+    {
+        RegionCounters regions[REGION_COUNT];
+        std::atomic<const char *> name;
+    };
+
+    ThreadSlot thread_slots[MAX_THREADS];
+    std::atomic<int> next_thread_slot(0);
+
+    // Threads beyond the table size share the last slot
+    const int SHARED_SLOT = MAX_THREADS - 1;
+
+    thread_local int current_thread_slot = -1;
+    thread_local int current_region = 0;
+
+    int thread_slot_index()
+    {
+        if (current_thread_slot < 0)
+        {
+            int slot = next_thread_slot.fetch_add(1, std::memory_order_relaxed);
+            current_thread_slot = std::min(slot, SHARED_SLOT);
+        }
+        return current_thread_slot;
+    }
+
+    // Owners update their slot with a plain load and store, only the shared slot needs a locked add
+    void add(std::atomic<uint64_t> &counter, uint64_t value, bool shared)
+    {
+        if (shared)
+        {
+            counter.fetch_add(value, std::memory_order_relaxed);
+        }
+        else
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+    }
+
+    void accumulate(AllocStats::Counters &sum, const RegionCounters &counters)
+    {
+        sum.allocations += counters.allocations.load(std::memory_order_relaxed);
+        sum.deallocations += counters.deallocations.load(std::memory_order_relaxed);
+        sum.bytes += counters.bytes.load(std::memory_order_relaxed);
+    }
+
+    int used_thread_slots()
+    {
+        return std::min(next_thread_slot.load(std::memory_order_relaxed), MAX_THREADS);
+    }
+}
+
+AllocStats::Scope::Scope(Region region)
+    : previous_(static_cast<Region>(current_region)), start_allocations_(for_thread().allocations)
+{
+    current_region = static_cast<int>(region);
+}
+
+AllocStats::Scope::~Scope()
+{
+    current_region = static_cast<int>(previous_);
+}
+
+uint64_t AllocStats::Scope::allocations() const
+{
+    return for_thread().allocations - start_allocations_;
+}
+
+bool AllocStats::enabled()
+{
+#ifdef ALLOC_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AllocStats::name_thread(const char *name)
+{
+    thread_slots[thread_slot_index()].name.store(name, std::memory_order_relaxed);
+}
+
+AllocStats::Counters AllocStats::for_thread()
+{
+    return for_thread_slot(thread_slot_index());
+}
+
+int AllocStats::thread_count()
+{
+    return used_thread_slots();
+}
+
+AllocStats::Counters AllocStats::for_thread_slot(int slot)
+{
+    Counters sum{0, 0, 0};
+    for (const RegionCounters &counters : thread_slots[slot].regions)
+    {
+        accumulate(sum, counters);
+    }
+    return sum;
+}
+
+const char *AllocStats::thread_name(int slot)
+{
+    return thread_slots[slot].name.load(std::memory_order_relaxed);
+}
+
+AllocStats::Counters AllocStats::for_region(Region region)
+{
+    Counters sum{0, 0, 0};
+    for (int i = 0; i < used_thread_slots(); ++i)
+    {
+        accumulate(sum, thread_slots[i].regions[static_cast<int>(region)]);
+    }
+    return sum;
+}
+
+AllocStats::Counters AllocStats::total()
+{
+    Counters sum{0, 0, 0};
+    for (int i = 0; i < used_thread_slots(); ++i)
+    {
+        for (const RegionCounters &counters : thread_slots[i].regions)
+        {
+            accumulate(sum, counters);
+        }
+    }
+    return sum;
+}
+
+const char *AllocStats::region_name(Region region)
+{
+    switch (region)
+    {
+    case Region::OTHER:
+        return "other";
+    case Region::FEED_RECEIVE:
+        return "feed_receive";
+    case Region::FEED_PARSE:
+        return "feed_parse";
+    case Region::ANALYTICS:
+        return "analytics";
+    case Region::FANOUT:
+        return "fanout";
+    case Region::ORDER_BUILD:
+        return "order_build";
+    case Region::ORDER_SEND:
+        return "order_send";
+    default:
+        return "unknown";
+    }
+}
+
+void AllocStats::record_allocation(std::size_t bytes)
+{
+    int slot = thread_slot_index();
+    RegionCounters &counters = thread_slots[slot].regions[current_region];
+    add(counters.allocations, 1, slot == SHARED_SLOT);
+    add(counters.bytes, bytes, slot == SHARED_SLOT);
+}
+
+void AllocStats::record_deallocation()
+{
+    int slot = thread_slot_index();
+    add(thread_slots[slot].regions[current_region].deallocations, 1, slot == SHARED_SLOT);
+}
+
+#ifdef ALLOC_STATS
+
+// Replacement global allocation functions. The array, nothrow, sized and aligned
+// forms all funnel through these so every heap allocation is counted once.
+
+namespace
+{
+    void *counted_alloc(std::size_t size, std::size_t alignment)
+    {
+        void *ptr = nullptr;
+        if (alignment <= alignof(std::max_align_t))
+        {
+            ptr = std::malloc(size ? size : 1);
+        }
+        else if (posix_memalign(&ptr, alignment, size ? size : 1) != 0)
+        {
+            ptr = nullptr;
+        }
+
+        if (ptr)
+        {
+            AllocStats::record_allocation(size);
+        }
+        return ptr;
+    }
+
+    void counted_free(void *ptr)
+    {
+        if (ptr)
+        {
+            AllocStats::record_deallocation();
+            std::free(ptr);
+        }
+    }
+}
+
+void *operator new(std::size_t size)
+{
+    void *ptr = counted_alloc(size, alignof(std::max_align_t));
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_alloc(size, alignof(std::max_align_t));
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_alloc(size, alignof(std::max_align_t));
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    void *ptr = counted_alloc(size, static_cast<std::size_t>(alignment));
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return ::operator new(size, alignment);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return counted_alloc(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return counted_alloc(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *ptr) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    counted_free(ptr);
+}
+
+#endif // ALLOC_STATS
@@ -0,0 +1,41 @@
+#include "alloc_stats.h"
+#include <cpprest/json.h>
+
+namespace
+{
+    web::json::value counters_json(const AllocStats::Counters &counters)
+    {
+        web::json::value json = web::json::value::object();
+        json[U("allocations")] = web::json::value::number(counters.allocations);
+        json[U("deallocations")] = web::json::value::number(counters.deallocations);
+        json[U("bytes")] = web::json::value::number(counters.bytes);
+        return json;
+    }
+}
+
+web::json::value AllocStats::to_json()
+{
+    web::json::value json = web::json::value::object();
+    json[U("enabled")] = web::json::value::boolean(enabled());
+    json[U("total")] = counters_json(total());
+
+    web::json::value regions = web::json::value::object();
+    for (int i = 0; i < static_cast<int>(Region::COUNT); ++i)
+    {
+        Region region = static_cast<Region>(i);
+        regions[U(region_name(region))] = counters_json(for_region(region));
+    }
+    json[U("regions")] = regions;
+
+    web::json::value threads = web::json::value::array();
+    for (int i = 0; i < thread_count(); ++i)
+    {
+        web::json::value thread = counters_json(for_thread_slot(i));
+        const char *name = thread_name(i);
+        thread[U("thread")] = name ? web::json::value::string(U(name)) : web::json::value::number(i);
+        threads[i] = thread;
+    }
+    json[U("threads")] = threads;
+
+    return json;
+}
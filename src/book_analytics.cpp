@@ -0,0 +1,313 @@
+#include "book_analytics.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+namespace
+{
+    const std::size_t CLEAN = std::numeric_limits<std::size_t>::max();
+    const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+    // Branch-free reduction over a contiguous array. Independent accumulators let the
+    // compiler vectorize without relaxing floating point ordering.
+    double sum_levels(const double *amounts, std::size_t count)
+    {
+        double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            s0 += amounts[i];
+            s1 += amounts[i + 1];
+            s2 += amounts[i + 2];
+            s3 += amounts[i + 3];
+        }
+        for (; i < count; ++i)
+        {
+            s0 += amounts[i];
+        }
+        return (s0 + s1) + (s2 + s3);
+    }
+
+    void set_metric(double &slot, double value, BookAnalytics::Metric metric, uint32_t &changed)
+    {
+        bool same = (slot == value) || (std::isnan(slot) && std::isnan(value));
+        if (!same)
+        {
+            slot = value;
+            changed |= metric;
+        }
+    }
+}
+
+BookAnalytics::BookAnalytics(std::size_t depth, int64_t trade_window_ms, std::size_t max_trades)
+    : depth_(depth), trade_window_ms_(trade_window_ms),
+      mid_(NaN), spread_(NaN), microprice_(NaN), imbalance_(NaN),
+      max_trades_(max_trades), trade_head_(0), trade_count_(0),
+      trade_notional_(0.0), trade_volume_(0.0), trade_flow_(0.0)
+{
+    for (Levels *lv : {&bids_, &asks_})
+    {
+        lv->prices.reserve(depth_);
+        lv->amounts.reserve(depth_);
+        lv->dirty_from = CLEAN;
+        lv->depth_amount = 0.0;
+    }
+}
+
+void BookAnalytics::mark_dirty(Levels &lv, std::size_t index)
+{
+    lv.dirty_from = std::min(lv.dirty_from, index);
+}
+
+void BookAnalytics::apply_snapshot(Side side, const double *prices, const double *amounts, std::size_t count)
+{
+    Levels &lv = levels(side);
+
+    // Only the levels from the first difference onwards need to be touched
+    std::size_t common = std::min(count, lv.prices.size());
+    std::size_t first = 0;
+    while (first < common && lv.prices[first] == prices[first] && lv.amounts[first] == amounts[first])
+    {
+        ++first;
+    }
+
+    if (first == count && count == lv.prices.size())
+    {
+        return;
+    }
+
+    lv.prices.resize(count);
+    lv.amounts.resize(count);
+    std::copy(prices + first, prices + count, lv.prices.begin() + first);
+    std::copy(amounts + first, amounts + count, lv.amounts.begin() + first);
+    mark_dirty(lv, first);
+}
+
+void BookAnalytics::apply_change(Side side, double price, double amount)
+{
+    Levels &lv = levels(side);
+
+    // Bids are kept in descending order, asks in ascending order
+    std::vector<double>::iterator it;
+    if (side == Side::Bid)
+    {
+        it = std::lower_bound(lv.prices.begin(), lv.prices.end(), price, std::greater<double>());
+    }
+    else
+    {
+        it = std::lower_bound(lv.prices.begin(), lv.prices.end(), price);
+    }
+
+    std::size_t index = it - lv.prices.begin();
+    bool exists = it != lv.prices.end() && *it == price;
+
+    if (amount <= 0.0)
+    {
+        if (!exists)
+        {
+            return;
+        }
+        lv.prices.erase(it);
+        lv.amounts.erase(lv.amounts.begin() + index);
+    }
+    else if (exists)
+    {
+        if (lv.amounts[index] == amount)
+        {
+            return;
+        }
+        lv.amounts[index] = amount;
+    }
+    else
+    {
+        lv.prices.insert(it, price);
+        lv.amounts.insert(lv.amounts.begin() + index, amount);
+    }
+
+    mark_dirty(lv, index);
+}
+
+uint32_t BookAnalytics::finish_update()
+{
+    uint32_t changed = 0;
+
+    bool top_dirty = bids_.dirty_from == 0 || asks_.dirty_from == 0;
+    bool depth_dirty = bids_.dirty_from < depth_ || asks_.dirty_from < depth_;
+
+    // Changes below the top N levels do not affect any published metric
+    for (Levels *lv : {&bids_, &asks_})
+    {
+        if (lv->dirty_from < depth_)
+        {
+            lv->depth_amount = sum_levels(lv->amounts.data(), std::min(depth_, lv->amounts.size()));
+        }
+        lv->dirty_from = CLEAN;
+    }
+
+    bool two_sided = !bids_.prices.empty() && !asks_.prices.empty();
+
+    if (top_dirty)
+    {
+        double mid = NaN, spread = NaN, microprice = NaN;
+        if (two_sided)
+        {
+            double bid_px = bids_.prices[0], bid_qty = bids_.amounts[0];
+            double ask_px = asks_.prices[0], ask_qty = asks_.amounts[0];
+
+            mid = 0.5 * (bid_px + ask_px);
+            spread = ask_px - bid_px;
+            microprice = (bid_px * ask_qty + ask_px * bid_qty) / (bid_qty + ask_qty);
+        }
+        set_metric(mid_, mid, MID, changed);
+        set_metric(spread_, spread, SPREAD, changed);
+        set_metric(microprice_, microprice, MICROPRICE, changed);
+    }
+
+    if (depth_dirty)
+    {
+        double total = bids_.depth_amount + asks_.depth_amount;
+        double imbalance = two_sided && total > 0.0 ? (bids_.depth_amount - asks_.depth_amount) / total : NaN;
+        set_metric(imbalance_, imbalance, IMBALANCE, changed);
+    }
+
+    return changed;
+}
+
+void BookAnalytics::drop_oldest_trade()
+{
+    const Trade &oldest = trades_[trade_head_];
+    trade_notional_ -= oldest.price * oldest.amount;
+    trade_volume_ -= oldest.amount;
+    trade_flow_ -= oldest.buy ? oldest.amount : -oldest.amount;
+
+    trade_head_ = (trade_head_ + 1) % trades_.size();
+    --trade_count_;
+
+    if (trade_count_ == 0)
+    {
+        // Reset running sums so rounding error does not accumulate across quiet periods
+        trade_notional_ = 0.0;
+        trade_volume_ = 0.0;
+        trade_flow_ = 0.0;
+    }
+}
+
+void BookAnalytics::evict_trades(int64_t now_ms)
+{
+    while (trade_count_ > 0 && trades_[trade_head_].timestamp_ms <= now_ms - trade_window_ms_)
+    {
+        drop_oldest_trade();
+    }
+}
+
+void BookAnalytics::reserve_trades()
+{
+    if (trades_.empty() && max_trades_ > 0)
+    {
+        // Instruments without trade metrics never pay for the ring
+        trades_.resize(max_trades_);
+    }
+}
+
+uint32_t BookAnalytics::add_trade(int64_t timestamp_ms, double price, double amount, bool buy)
+{
+    if (max_trades_ == 0)
+    {
+        return 0;
+    }
+    reserve_trades();
+
+    double old_vwap = value(VWAP);
+    double old_flow = trade_flow_;
+
+    evict_trades(timestamp_ms);
+    if (trade_count_ == trades_.size())
+    {
+        drop_oldest_trade();
+    }
+
+    trades_[(trade_head_ + trade_count_) % trades_.size()] = Trade{timestamp_ms, price, amount, buy};
+    ++trade_count_;
+
+    trade_notional_ += price * amount;
+    trade_volume_ += amount;
+    trade_flow_ += buy ? amount : -amount;
+
+    uint32_t changed = 0;
+    set_metric(old_vwap, value(VWAP), VWAP, changed);
+    set_metric(old_flow, trade_flow_, TRADE_FLOW, changed);
+    return changed;
+}
+
+uint32_t BookAnalytics::expire_trades(int64_t now_ms)
+{
+    if (trade_count_ == 0)
+    {
+        return 0;
+    }
+
+    double old_vwap = value(VWAP);
+    double old_flow = trade_flow_;
+
+    evict_trades(now_ms);
+
+    uint32_t changed = 0;
+    set_metric(old_vwap, value(VWAP), VWAP, changed);
+    set_metric(old_flow, trade_flow_, TRADE_FLOW, changed);
+    return changed;
+}
+
+double BookAnalytics::value(Metric metric) const
+{
+    switch (metric)
+    {
+    case MID:
+        return mid_;
+    case SPREAD:
+        return spread_;
+    case MICROPRICE:
+        return microprice_;
+    case IMBALANCE:
+        return imbalance_;
+    case VWAP:
+        return trade_volume_ > 0.0 ? trade_notional_ / trade_volume_ : NaN;
+    case TRADE_FLOW:
+        return trade_flow_;
+    default:
+        return NaN;
+    }
+}
+
+const char *BookAnalytics::metric_name(Metric metric)
+{
+    switch (metric)
+    {
+    case MID:
+        return "mid";
+    case SPREAD:
+        return "spread";
+    case MICROPRICE:
+        return "microprice";
+    case IMBALANCE:
+        return "imbalance";
+    case VWAP:
+        return "vwap";
+    case TRADE_FLOW:
+        return "flow";
+    default:
+        return "unknown";
+    }
+}
+
+uint32_t BookAnalytics::metric_from_name(const std::string &name)
+{
+    for (Metric metric : {MID, SPREAD, MICROPRICE, IMBALANCE, VWAP, TRADE_FLOW})
+    {
+        if (name == metric_name(metric))
+        {
+            return metric;
+        }
+    }
+    return 0;
+}
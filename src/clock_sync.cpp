@@ -0,0 +1,69 @@
+#include "clock_sync.h"
+#include <chrono>
+#include <cmath>
+
+ClockSync::ClockSync(std::size_t window)
+    : samples_(window ? window : 1), next_sample_(0), sample_count_(0), total_samples_(0),
+      offset_us_(0), rtt_us_(0), jitter_us_(0), last_sample_us_(0)
+{
+}
+
+int64_t ClockSync::now_us()
+{
+    auto now = std::chrono::system_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+}
+
+void ClockSync::add_sample(int64_t t0, int64_t t1, int64_t t2, int64_t t3)
+{
+    // Standard NTP estimates, the exchange hold time t2 - t1 is excluded from the delay
+    Sample sample;
+    sample.offset_us = ((t1 - t0) + (t2 - t3)) / 2;
+    sample.rtt_us = (t3 - t0) - (t2 - t1);
+    if (sample.rtt_us < 0)
+    {
+        sample.rtt_us = 0;
+    }
+
+    samples_[next_sample_] = sample;
+    next_sample_ = (next_sample_ + 1) % samples_.size();
+    if (sample_count_ < samples_.size())
+    {
+        ++sample_count_;
+    }
+    ++total_samples_;
+    last_sample_us_ = t3;
+
+    // Clock filter: the lowest delay sample carries the least queueing error
+    const Sample *best = &samples_[0];
+    for (std::size_t i = 1; i < sample_count_; ++i)
+    {
+        if (samples_[i].rtt_us < best->rtt_us)
+        {
+            best = &samples_[i];
+        }
+    }
+    offset_us_ = best->offset_us;
+    rtt_us_ = best->rtt_us;
+
+    // Jitter is the RMS offset difference of the window against the selected sample
+    double sum_squares = 0.0;
+    for (std::size_t i = 0; i < sample_count_; ++i)
+    {
+        double diff = static_cast<double>(samples_[i].offset_us - offset_us_);
+        sum_squares += diff * diff;
+    }
+    jitter_us_ = static_cast<int64_t>(std::sqrt(sum_squares / sample_count_));
+}
+
+web::json::value ClockSync::to_json() const
+{
+    web::json::value json = web::json::value::object();
+    json[U("synced")] = web::json::value::boolean(synced());
+    json[U("samples")] = web::json::value::number(total_samples_);
+    json[U("offset_us")] = web::json::value::number(offset_us_);
+    json[U("rtt_us")] = web::json::value::number(rtt_us_);
+    json[U("jitter_us")] = web::json::value::number(jitter_us_);
+    json[U("last_sample_us")] = web::json::value::number(last_sample_us_);
+    return json;
+}
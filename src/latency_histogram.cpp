@@ -0,0 +1,53 @@
+#include "latency_histogram.h"
+#include <algorithm>
+#include <limits>
+
+const int64_t LatencyHistogram::BUCKET_BOUNDS_US[BUCKET_COUNT] = {
+    50, 100, 250, 500,
+    1000, 2500, 5000, 10000,
+    25000, 50000, 100000, 250000,
+    500000, 1000000, 5000000, std::numeric_limits<int64_t>::max()};
+
+LatencyHistogram::LatencyHistogram()
+    : buckets_(), count_(0), sum_(0), min_(0), max_(0), last_(0)
+{
+}
+
+void LatencyHistogram::record(int64_t latency_us)
+{
+    // Negative values come from clock offset error, keep them in the gauges but bucket them as zero
+    std::size_t bucket = std::upper_bound(BUCKET_BOUNDS_US, BUCKET_BOUNDS_US + BUCKET_COUNT - 1, std::max<int64_t>(latency_us, 0) - 1) - BUCKET_BOUNDS_US;
+    ++buckets_[bucket];
+
+    min_ = count_ == 0 ? latency_us : std::min(min_, latency_us);
+    max_ = count_ == 0 ? latency_us : std::max(max_, latency_us);
+    ++count_;
+    sum_ += latency_us;
+    last_ = latency_us;
+}
+
+double LatencyHistogram::mean() const
+{
+    return count_ == 0 ? 0.0 : static_cast<double>(sum_) / count_;
+}
+
+web::json::value LatencyHistogram::to_json() const
+{
+    web::json::value json = web::json::value::object();
+    json[U("count")] = web::json::value::number(count_);
+    json[U("last_us")] = web::json::value::number(last_);
+    json[U("min_us")] = web::json::value::number(min_);
+    json[U("max_us")] = web::json::value::number(max_);
+    json[U("mean_us")] = web::json::value::number(mean());
+
+    // Buckets keyed by their upper bound, "inf" for the open ended one
+    web::json::value buckets = web::json::value::object();
+    for (std::size_t i = 0; i < BUCKET_COUNT; ++i)
+    {
+        std::string bound = i + 1 < BUCKET_COUNT ? std::to_string(BUCKET_BOUNDS_US[i]) : "inf";
+        buckets[U("le_" + bound)] = web::json::value::number(buckets_[i]);
+    }
+    json[U("buckets_us")] = buckets;
+
+    return json;
+}
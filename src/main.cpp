@@ -72,7 +72,8 @@ int main()
             std::cout << "4. Cancel Order\n";
             std::cout << "5. Get Order Book\n";
             std::cout << "6. Subscribe to Channel\n";
-            std::cout << "7. Exit\n";
+            std::cout << "7. View Stats\n";
+            std::cout << "8. Exit\n";
             std::cout << "Enter your choice: ";
             std::cin >> choice;
 
@@ -158,6 +159,12 @@ int main()
                 break;
             }
             case 7:
+            {
+                // View Stats
+                order_exec.view_stats();
+                break;
+            }
+            case 8:
                 // Exit
                 std::cout << "Exiting the platform...\n";
                 break;
@@ -165,7 +172,7 @@ int main()
                 std::cout << "Invalid choice. Please try again.\n";
                 break;
             }
-        } while (choice != 7);
+        } while (choice != 8);
 
         deribit_client.close();
         local_client.close();
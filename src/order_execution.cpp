@@ -1,20 +1,30 @@
 #include "order_execution.h"
-#include <sstream>
-#include <iomanip>
+#include "alloc_stats.h"
 #include <spdlog/spdlog.h>
 
+// How often the exchange clock offset is re-sampled
+const int64_t CLOCK_SYNC_INTERVAL_US = 30 * 1000000LL;
+
 OrderExecution::OrderExecution(const std::string &api_key, const std::string &api_secret, const std::string &access_token, WebSocketClient &deribit_client, WebSocketClient &local_client)
-    : api_key_(api_key), api_secret_(api_secret), deribit_client_(deribit_client), local_client_(local_client), access_token_(access_token) {}
+    : api_key_(api_key), api_secret_(api_secret), deribit_client_(deribit_client), local_client_(local_client), access_token_(access_token), request_builder_(api_key, api_secret), orders_built_(0),
+      last_send_us_(0), last_receive_us_(0)
+{
+    // Sample the clock before the first order so nothing has to block on it later
+    sync_clock_if_due();
+}
 
 web::json::value OrderExecution::send_and_receive_request(const std::string &request)
 {
     try
     {
-        web::json::value message = web::json::value::parse(request);
+        // The request is already serialized, send it without a JSON round trip
         web::json::value response;
-        deribit_client_.send_message(message);
-        deribit_client_.receive_message([&response](const web::json::value &msg)
-                                        { response = msg; });
+        last_send_us_ = ClockSync::now_us();
+        deribit_client_.send_raw(request);
+        deribit_client_.receive_message([this, &response](const web::json::value &msg, const std::string &, int64_t arrival_us)
+                                        {
+            response = msg;
+            last_receive_us_ = arrival_us; });
 
         // Step 5: Check the response
         if (response.has_field("error"))
@@ -32,37 +42,12 @@ web::json::value OrderExecution::send_and_receive_request(const std::string &req
     }
 }
 
-std::string OrderExecution::create_signed_request(const std::string &params, const std::string &request_type)
+const std::string &OrderExecution::create_signed_request(fmt::string_view params, fmt::string_view request_type)
 {
     try
     {
-        auto now = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch());
-        std::string nonce = std::to_string(duration.count()); // Nonce as the current timestamp in milliseconds
-
-        std::string request_data = "api_key=" + api_key_ + "&nonce=" + nonce + "&params=" + params;
-
-        // Generate the signature using HMAC SHA-256
-        unsigned char *result;
-        result = HMAC(EVP_sha256(), api_secret_.c_str(), api_secret_.length(), (unsigned char *)request_data.c_str(), request_data.length(), NULL, NULL);
-
-        // Convert the result to a hex string
-        std::stringstream ss;
-        for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
-        {
-            ss << std::hex << std::setw(2) << std::setfill('0') << (int)result[i];
-        }
-        std::string signature = ss.str();
-
-        // Create the JSON request string with the signature and other necessary parameters
-        std::string request = "{\"jsonrpc\": \"2.0\", \"method\": \"" + request_type + "\", "
-                                                                                       "\"params\": {" +
-                              params + "}, \"nonce\": \"" + nonce + "\", "
-                                                                    "\"api_key\": \"" +
-                              api_key_ + "\", \"signature\": \"" + signature + "\"}";
-
+        const std::string &request = request_builder_.signed_request(params, request_type);
         spdlog::info("Created signed request.");
-
         return request;
     }
     catch (const std::exception &e)
@@ -91,42 +76,37 @@ void OrderExecution::place_order(const std::string &instrument_name, double amou
         throw std::invalid_argument("Price must be greater than zero for limit orders.");
     }
 
-    const std::string request_type = "private/" + order_type;
-    std::string params;
-
-    try
+    const std::string *request;
     {
-        if (market)
+        AllocStats::Scope scope(AllocStats::Region::ORDER_BUILD);
+
+        try
         {
-            params = "\"instrument_name\": \"" + instrument_name +
-                     "\", \"amount\": " + std::to_string(amount) +
-                     ", \"type\": \"market\", "
-                     "\"direction\": \"" +
-                     order_type + "\"";
+            request = &request_builder_.place_order(instrument_name, amount, price, order_type, market);
         }
-        else
+        catch (const std::exception &e)
         {
-            params = "\"instrument_name\": \"" + instrument_name +
-                     "\", \"amount\": " + std::to_string(amount) +
-                     ", \"type\": \"limit\", \"price\": " + std::to_string(price) +
-                     ", \"direction\": \"" + order_type + "\"";
+            spdlog::error("Error constructing request parameters: {}", e.what());
+            throw std::runtime_error("Error constructing request parameters.");
         }
-    }
-    catch (const std::exception &e)
-    {
-        spdlog::error("Error constructing request parameters: {}", e.what());
-        throw std::runtime_error("Error constructing request parameters.");
-    }
 
-    std::string request = create_signed_request(params, request_type);
+        // Request buffers are sized by the first order, later request strings must not allocate
+        if (++orders_built_ > 1 && scope.allocations() > 0)
+        {
+            spdlog::warn("Building order request allocated {} times after warm-up", scope.allocations());
+        }
+    }
 
     spdlog::info("Placing order for instrument: {}, amount: {}, price: {}, order type: {}",
                  instrument_name, amount, price, order_type);
 
     try
     {
-        web::json::value response = send_and_receive_request(request);
+        AllocStats::Scope scope(AllocStats::Region::ORDER_SEND);
+        web::json::value response = send_and_receive_request(*request);
+        record_ack_latency(response);
         spdlog::info("Order placed successfully. Response: {}", response.serialize());
+        sync_clock_if_due();
     }
     catch (const std::exception &e)
     {
@@ -137,15 +117,14 @@ void OrderExecution::place_order(const std::string &instrument_name, double amou
 
 void OrderExecution::cancel_order(const std::string &order_id)
 {
-    const std::string request_type = "private/cancel";
-
-    std::string params = "\"order_id\": \"" + order_id + "\"";
-    std::string request = create_signed_request(params, request_type);
+    const std::string &request = request_builder_.cancel_order(order_id);
 
     try
     {
         web::json::value response = send_and_receive_request(request);
+        record_ack_latency(response);
         spdlog::info("Order Cancelled Successfully. Response: {}", response.serialize());
+        sync_clock_if_due();
     }
     catch (const std::exception &e)
     {
@@ -186,7 +165,7 @@ void OrderExecution::view_open_orders()
 {
     const std::string request_type = "private/get_open_orders";
 
-    std::string request = create_signed_request("", request_type);
+    const std::string &request = create_signed_request("", request_type);
 
     try
     {
@@ -204,7 +183,7 @@ void OrderExecution::view_position()
 {
     const std::string request_type = "private/get_positions";
 
-    std::string request = create_signed_request("", request_type);
+    const std::string &request = create_signed_request("", request_type);
 
     try
     {
@@ -220,18 +199,14 @@ void OrderExecution::view_position()
 
 void OrderExecution::modify_order(const std::string &order_id, int amount, double price)
 {
-    const std::string request_type = "private/edit";
-
-    std::string params = "\"order_id\": \"" + order_id + "\", " +
-                         "\"amount\": " + std::to_string(amount) + ", " +
-                         "\"price\": \"" + std::to_string(price) + "\"";
-
-    std::string request = create_signed_request(params, request_type);
+    const std::string &request = request_builder_.modify_order(order_id, amount, price);
 
     try
     {
         web::json::value response = send_and_receive_request(request);
+        record_ack_latency(response);
         spdlog::info("Edited the given order: {}", response.serialize());
+        sync_clock_if_due();
     }
     catch (const std::exception &e)
     {
@@ -280,3 +255,107 @@ void OrderExecution::subscribe(const std::string &instrument_name)
         throw;
     }
 }
+
+void OrderExecution::view_stats()
+{
+    spdlog::info("Local allocation stats: {}", AllocStats::to_json().serialize());
+
+    web::json::value latency = web::json::value::object();
+    latency[U("clock")] = clock_sync_.to_json();
+    latency[U("order_ack")] = order_ack_latency_.to_json();
+    latency[U("order_ack_one_way")] = order_ack_one_way_.to_json();
+    latency[U("exchange_processing")] = exchange_processing_.to_json();
+    spdlog::info("Order latency stats: {}", latency.serialize());
+
+    // Ask the local server for its stats as well
+    web::json::value stats_request = web::json::value::object();
+    stats_request[U("action")] = web::json::value::string(U("stats"));
+
+    try
+    {
+        local_client_.send_message(stats_request);
+
+        web::json::value response;
+        local_client_.receive_message([&response](const web::json::value &msg)
+                                      { response = msg; });
+
+        spdlog::info("Server stats: {}", response.serialize());
+    }
+    catch (const std::exception &e)
+    {
+        spdlog::error("Error viewing stats: {}", e.what());
+        throw;
+    }
+}
+
+void OrderExecution::sync_clock()
+{
+    web::json::value message = web::json::value::object();
+    message[U("jsonrpc")] = web::json::value::string(U("2.0"));
+    message[U("id")] = web::json::value::number(3);
+    message[U("method")] = web::json::value::string(U("public/get_time"));
+    message[U("params")] = web::json::value::object();
+
+    int64_t sent_us = ClockSync::now_us();
+    deribit_client_.send_message(message);
+
+    web::json::value response;
+    int64_t received_us = 0;
+    deribit_client_.receive_message([&response, &received_us](const web::json::value &msg, const std::string &, int64_t arrival_us)
+                                    {
+        response = msg;
+        received_us = arrival_us; });
+
+    if (!response.has_field(U("result")))
+    {
+        spdlog::error("Clock sync failed. Response: {}", response.serialize());
+        throw std::runtime_error("Clock sync failed. Check response for details.");
+    }
+
+    // usIn / usOut are the exchange receive and send times, the millisecond result is the fallback
+    int64_t server_us = response[U("result")].as_number().to_int64() * 1000;
+    int64_t exchange_in_us = response.has_field(U("usIn")) ? response[U("usIn")].as_number().to_int64() : server_us;
+    int64_t exchange_out_us = response.has_field(U("usOut")) ? response[U("usOut")].as_number().to_int64() : server_us;
+
+    clock_sync_.add_sample(sent_us, exchange_in_us, exchange_out_us, received_us);
+    spdlog::info("Exchange clock offset: {} us, round trip: {} us", clock_sync_.offset_us(), clock_sync_.rtt_us());
+}
+
+// Called at construction and after an order is acknowledged, never ahead of a
+// request, so a get_time round trip does not delay an order going out
+void OrderExecution::sync_clock_if_due()
+{
+    if (clock_sync_.synced() && ClockSync::now_us() - clock_sync_.last_sample_us() < CLOCK_SYNC_INTERVAL_US)
+    {
+        return;
+    }
+
+    // Latency splits are best effort, an order must not fail because of them
+    try
+    {
+        sync_clock();
+    }
+    catch (const std::exception &e)
+    {
+        spdlog::warn("Error syncing exchange clock: {}", e.what());
+    }
+}
+
+void OrderExecution::record_ack_latency(const web::json::value &response)
+{
+    order_ack_latency_.record(last_receive_us_ - last_send_us_);
+
+    if (response.has_field(U("usIn")) && response.has_field(U("usOut")))
+    {
+        int64_t exchange_in_us = response.at(U("usIn")).as_number().to_int64();
+        int64_t exchange_out_us = response.at(U("usOut")).as_number().to_int64();
+
+        exchange_processing_.record(exchange_out_us - exchange_in_us);
+        // The clock is only re-sampled after an ack, so after an idle period the offset is too old
+        // to split the round trip and the one-way sample is skipped
+        if (clock_sync_.synced() && ClockSync::now_us() - clock_sync_.last_sample_us() <= CLOCK_SYNC_INTERVAL_US)
+        {
+            order_ack_one_way_.record(clock_sync_.to_local_us(exchange_in_us) - last_send_us_);
+        }
+    }
+}
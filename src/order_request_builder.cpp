@@ -0,0 +1,86 @@
+#include "order_request_builder.h"
+#include <chrono>
+#include <iterator>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+// Large enough for any order request, so the request buffer does not grow after construction
+const std::size_t REQUEST_RESERVE = 1024;
+
+OrderRequestBuilder::OrderRequestBuilder(const std::string &api_key, const std::string &api_secret)
+    : api_key_(api_key), api_secret_(api_secret)
+{
+    request_.reserve(REQUEST_RESERVE);
+}
+
+const std::string &OrderRequestBuilder::place_order(const std::string &instrument_name, double amount, double price, const std::string &direction, bool market)
+{
+    params_.clear();
+    if (market)
+    {
+        fmt::format_to(std::back_inserter(params_),
+                       "\"instrument_name\": \"{}\", \"amount\": {}, \"type\": \"market\", \"direction\": \"{}\"",
+                       instrument_name, amount, direction);
+    }
+    else
+    {
+        fmt::format_to(std::back_inserter(params_),
+                       "\"instrument_name\": \"{}\", \"amount\": {}, \"type\": \"limit\", \"price\": {}, \"direction\": \"{}\"",
+                       instrument_name, amount, price, direction);
+    }
+
+    method_.clear();
+    fmt::format_to(std::back_inserter(method_), "private/{}", direction);
+
+    return signed_request(fmt::string_view(params_.data(), params_.size()), fmt::string_view(method_.data(), method_.size()));
+}
+
+const std::string &OrderRequestBuilder::cancel_order(const std::string &order_id)
+{
+    params_.clear();
+    fmt::format_to(std::back_inserter(params_), "\"order_id\": \"{}\"", order_id);
+
+    return signed_request(fmt::string_view(params_.data(), params_.size()), "private/cancel");
+}
+
+const std::string &OrderRequestBuilder::modify_order(const std::string &order_id, int amount, double price)
+{
+    params_.clear();
+    fmt::format_to(std::back_inserter(params_), "\"order_id\": \"{}\", \"amount\": {}, \"price\": \"{}\"",
+                   order_id, amount, price);
+
+    return signed_request(fmt::string_view(params_.data(), params_.size()), "private/edit");
+}
+
+const std::string &OrderRequestBuilder::signed_request(fmt::string_view params, fmt::string_view method)
+{
+    auto now = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch());
+    long long nonce = duration.count(); // Nonce as the current timestamp in milliseconds
+
+    // The request buffer first holds the signed payload, then the final request
+    request_.clear();
+    fmt::format_to(std::back_inserter(request_), "api_key={}&nonce={}&params={}", api_key_, nonce, params);
+
+    // Generate the signature using HMAC SHA-256
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    HMAC(EVP_sha256(), api_secret_.c_str(), api_secret_.length(), (unsigned char *)request_.c_str(), request_.length(), digest, &digest_length);
+
+    // Convert the result to a hex string
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    char signature[2 * EVP_MAX_MD_SIZE];
+    for (unsigned int i = 0; i < digest_length; i++)
+    {
+        signature[2 * i] = HEX_DIGITS[digest[i] >> 4];
+        signature[2 * i + 1] = HEX_DIGITS[digest[i] & 0x0f];
+    }
+
+    // Create the JSON request string with the signature and other necessary parameters
+    request_.clear();
+    fmt::format_to(std::back_inserter(request_),
+                   "{{\"jsonrpc\": \"2.0\", \"method\": \"{}\", \"params\": {{{}}}, \"nonce\": \"{}\", \"api_key\": \"{}\", \"signature\": \"{}\"}}",
+                   method, params, nonce, api_key_, fmt::string_view(signature, 2 * digest_length));
+
+    return request_;
+}
@@ -1,4 +1,5 @@
 #include "websocket_client.h"
+#include "clock_sync.h"
 #include <iostream>
 
 WebSocketClient::WebSocketClient(const std::string &url) : url_(url), is_closed(false)
@@ -35,13 +36,34 @@ void WebSocketClient::send_message(const web::json::value &message)
     client_.send(outgoing_msg).wait();
 }
 
+void WebSocketClient::send_raw(const std::string &text)
+{
+    web::websockets::client::websocket_outgoing_message outgoing_msg;
+
+    outgoing_msg.set_utf8_message(text);
+    client_.send(outgoing_msg).wait();
+}
+
 void WebSocketClient::receive_message(std::function<void(const web::json::value &)> callback)
 {
-    client_.receive().then([=](web::websockets::client::websocket_incoming_message incoming_message)
+    receive_message([&callback](const web::json::value &message, const std::string &, int64_t)
+                    { callback(message); });
+}
+
+void WebSocketClient::receive_message(std::function<void(const web::json::value &, const std::string &, int64_t)> callback)
+{
+    client_.receive().then([&](web::websockets::client::websocket_incoming_message incoming_message)
                            {
-        auto msg = incoming_message.extract_string().get();
-        web::json::value json_message = web::json::value::parse(msg);
-        callback(json_message); })
+        int64_t arrival_us = ClockSync::now_us();
+
+        // Read the frame into the reused buffer instead of a fresh string per message
+        receive_buffer_.resize(incoming_message.length());
+        if (!receive_buffer_.empty())
+        {
+            incoming_message.body().streambuf().getn(reinterpret_cast<uint8_t *>(&receive_buffer_[0]), receive_buffer_.size()).get();
+        }
+        web::json::value json_message = web::json::value::parse(receive_buffer_);
+        callback(json_message, receive_buffer_, arrival_us); })
         .wait();
 }
 
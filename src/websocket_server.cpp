@@ -3,12 +3,65 @@
 #include <websocketpp/server.hpp>
 #include <cpprest/json.h>
 #include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <chrono>
 #include <spdlog/spdlog.h>
+#include <spdlog/fmt/fmt.h>
 
 // Include a client for communicating with Deribit
 #include "websocket_client.h"
 
-WebSocketServer::WebSocketServer() : deribit_client_("wss://test.deribit.com/ws/api/v2")
+namespace
+{
+    // Channel of a subscription notification, nullptr for any other message
+    const std::string *notification_channel(const web::json::value &update)
+    {
+        if (!update.has_field(U("params")) || !update.at(U("params")).has_field(U("channel")))
+        {
+            return nullptr;
+        }
+        return &update.at(U("params")).at(U("channel")).as_string();
+    }
+}
+
+// Updates processed before analytics allocations are treated as steady-state violations
+const uint64_t ALLOC_WARMUP_UPDATES = 100;
+
+// Exchange clock sampling
+const std::chrono::seconds CLOCK_SYNC_INTERVAL(10);
+const int64_t TIME_REQUEST_ID_BASE = 1000; // public/get_time request ids start here
+const std::size_t MAX_PENDING_TIME_REQUESTS = 16;
+
+// Micro-batching limits, a batch is flushed early once it reaches MAX_BATCH_BYTES
+const uint32_t MAX_BATCH_MS = 1000;
+const std::size_t MAX_BATCH_BYTES = 64 * 1024;
+
+#ifdef WS_PERMESSAGE_DEFLATE
+thread_local uint64_t deflate_config::permessage_deflate_type::compressed_bytes = 0;
+#endif
+
+namespace
+{
+    // Compressed bytes produced so far by permessage-deflate on the calling thread
+    uint64_t compressed_bytes_on_thread()
+    {
+#ifdef WS_PERMESSAGE_DEFLATE
+        return deflate_config::permessage_deflate_type::compressed_bytes;
+#else
+        return 0;
+#endif
+    }
+}
+
+WebSocketServer::WebSocketServer(uint32_t batch_ms, uint32_t stale_book_ms)
+    : deribit_client_("wss://test.deribit.com/ws/api/v2"), reader_started_(false), clock_started_(false), updates_processed_(0), steady_state_allocations_(0), setup_allocations_(0),
+      next_time_request_id_(TIME_REQUEST_ID_BASE), stale_book_us_(static_cast<int64_t>(stale_book_ms) * 1000), stale_books_(0),
+      default_batch_ms_(std::min(batch_ms, MAX_BATCH_MS)), frames_sent_(0), updates_sent_(0), uncompressed_payload_bytes_(0),
+      compressed_payload_bytes_(0), fanout_start_us_(0)
 {
     m_server.init_asio();
 
@@ -51,12 +104,33 @@ void WebSocketServer::on_open(websocketpp::connection_hdl hdl)
 {
     std::cout << "New connection opened!" << std::endl;
     connections_.insert(hdl);
+
+    // The handshake response only carries the extension if the client offered it and it was accepted
+    server::connection_ptr con = m_server.get_con_from_hdl(hdl);
+    bool deflate = con->get_response_header("Sec-WebSocket-Extensions").find("permessage-deflate") != std::string::npos;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    connection_state_[hdl] = ConnectionState{default_batch_ms_, std::string(), 0, 0, deflate};
 }
 
 void WebSocketServer::on_close(websocketpp::connection_hdl hdl)
 {
     std::cout << "Connection closed!" << std::endl;
     connections_.erase(hdl);
+
+    // Stop fanning updates out to the closed connection
+    std::lock_guard<std::mutex> lock(mutex_);
+    connection_state_.erase(hdl);
+
+    std::owner_less<websocketpp::connection_hdl> less;
+    for (auto &entry : subscriptions_)
+    {
+        auto &subscribers = entry.second;
+        subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+                                         [&](const Subscription &sub)
+                                         { return !less(sub.hdl, hdl) && !less(hdl, sub.hdl); }),
+                          subscribers.end());
+    }
 }
 
 void WebSocketServer::on_message(websocketpp::connection_hdl hdl, server::message_ptr msg)
@@ -75,10 +149,41 @@ void WebSocketServer::on_message(websocketpp::connection_hdl hdl, server::messag
             std::string instrument = json_message[U("instrument")].as_string();
             spdlog::info("Subscription request for instrument: {}", instrument);
 
-            // Build the Deribit channel name
-            std::string channel_name = "book." + instrument + ".none.10.100ms";
+            // Optional analytics channels requested by the client, e.g. "analytics": ["mid", "vwap"]
+            uint32_t metrics = 0;
+            if (json_message.has_field(U("analytics")))
+            {
+                for (const auto &name : json_message[U("analytics")].as_array())
+                {
+                    uint32_t metric = BookAnalytics::metric_from_name(name.as_string());
+                    if (metric == 0)
+                    {
+                        spdlog::warn("Unknown analytics channel: {}", name.as_string());
+                    }
+                    metrics |= metric;
+                }
+            }
+
+            // Optional micro-batching window for this connection, e.g. "batch_ms": 5
+            int batch_ms = -1;
+            if (json_message.has_field(U("batch_ms")))
+            {
+                batch_ms = std::min<int>(std::max(json_message[U("batch_ms")].as_integer(), 0), MAX_BATCH_MS);
+            }
+
+            // Build the Deribit channel names, trade-derived metrics need the trades channel as well
+            std::vector<std::string> channel_names{"book." + instrument + ".none.10.100ms"};
+            if (metrics & BookAnalytics::TRADE_METRICS)
+            {
+                channel_names.push_back("trades." + instrument + ".100ms");
+            }
+
             web::json::value channels = web::json::value::array();
-            channels[0] = web::json::value::string(U(channel_name));
+            for (std::size_t i = 0; i < channel_names.size(); ++i)
+            {
+                channels[i] = web::json::value::string(U(channel_names[i]));
+            }
+            const std::string &channel_name = channel_names[0];
 
             // Create the Deribit subscription request
             web::json::value deribit_request = web::json::value::object();
@@ -93,46 +198,539 @@ void WebSocketServer::on_message(websocketpp::connection_hdl hdl, server::messag
             deribit_client_.send_message(deribit_request);
             spdlog::info("Sent subscription request to Deribit for channel: {}", channel_name);
 
-            // Forward updates from Deribit to the client asynchronously
-            std::thread([this, hdl]()
-                        {
+            // Register the client, updates are fanned out by a single reader thread
+            std::lock_guard<std::mutex> lock(mutex_);
+            subscriptions_[instrument].push_back(Subscription{hdl, metrics, channel_names});
+
+            auto state = connection_state_.find(hdl);
+            if (batch_ms >= 0 && state != connection_state_.end())
+            {
+                // Send the pending batch first, so updates already queued are not overtaken
+                flush_batch(hdl);
+                state->second.batch_ms = batch_ms;
+            }
+            if (!reader_started_)
+            {
+                std::thread(&WebSocketServer::read_updates, this).detach();
+                reader_started_ = true;
+            }
+            if (!clock_started_)
+            {
+                std::thread(&WebSocketServer::sample_clock, this).detach();
+                clock_started_ = true;
+            }
+        }
+        else if (json_message[U("action")].as_string() == "stats")
+        {
+            m_server.send(hdl, collect_stats().serialize(), websocketpp::frame::opcode::text);
+        }
+        else
+        {
+            spdlog::warn("Unsupported action: {}", json_message[U("action")].as_string());
+            m_server.send(hdl, "Unsupported action", websocketpp::frame::opcode::text);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        spdlog::error("Error processing message: {}", e.what());
+        m_server.send(hdl, "Error processing your request", websocketpp::frame::opcode::text);
+    }
+}
+
+void WebSocketServer::read_updates()
+{
+    AllocStats::name_thread("deribit_reader");
+
+    // One reader serves every client, so a malformed update is skipped rather than ending fan-out.
+    // Only a failure of the Deribit connection itself stops the reader.
+    while (true)
+    {
+        try
+        {
+            AllocStats::Scope scope(AllocStats::Region::FEED_RECEIVE);
+            deribit_client_.receive_message([this](const web::json::value &update, const std::string &text, int64_t arrival_us)
+                                            {
                 try
                 {
-                    while (true)
-                    {
-                        web::json::value update;
-                        deribit_client_.receive_message([&update](const web::json::value &msg)
-                                                        { update = msg; });
+                    handle_update(update, text, arrival_us);
+                }
+                catch (const std::exception &e)
+                {
+                    spdlog::warn("Skipping update that could not be processed: {}: {}", e.what(), text);
+                } });
+        }
+        catch (const web::json::json_exception &e)
+        {
+            spdlog::warn("Skipping update that could not be parsed: {}", e.what());
+        }
+        catch (const std::exception &e)
+        {
+            spdlog::error("Error while forwarding updates to clients: {}", e.what());
+            break;
+        }
+    }
+
+    // Let the next subscription start a new reader
+    std::lock_guard<std::mutex> lock(mutex_);
+    reader_started_ = false;
+}
+
+void WebSocketServer::handle_update(const web::json::value &update, const std::string &text, int64_t arrival_us)
+{
+    spdlog::debug("Received update from Deribit: {}", text);
+
+    std::lock_guard<std::mutex> lock(mutex_); // Ensure thread safety
+
+    if (handle_time_response(update, arrival_us) || !record_feed_delay(update, arrival_us))
+    {
+        return;
+    }
+
+    // Derived metrics are computed once per update and only published if they changed
+    uint32_t changed;
+    {
+        AllocStats::Scope scope(AllocStats::Region::ANALYTICS);
+        setup_allocations_ = 0;
+        changed = update_analytics(update, update_instrument_);
+
+        // Applying an update to the analytics must not allocate once buffers are warmed up,
+        // first-touch setup of a new instrument or trade ring is expected and not counted
+        uint64_t allocations = scope.allocations() - setup_allocations_;
+        if (++updates_processed_ > ALLOC_WARMUP_UPDATES && allocations > 0)
+        {
+            if (steady_state_allocations_ == 0)
+            {
+                spdlog::warn("Analytics update allocated {} times after warm-up", allocations);
+            }
+            steady_state_allocations_ += allocations;
+        }
+    }
+
+    auto it = subscriptions_.find(update_instrument_);
+    if (update_instrument_.empty() || it == subscriptions_.end())
+    {
+        return;
+    }
+    const std::string &channel = *notification_channel(update);
+
+    // Forward the received text unchanged to every client subscribed to its channel
+    AllocStats::Scope scope(AllocStats::Region::FANOUT);
+    for (const Subscription &sub : it->second)
+    {
+        if (std::find(sub.channels.begin(), sub.channels.end(), channel) != sub.channels.end())
+        {
+            send_update(sub.hdl, text.data(), text.size());
+        }
+        if (changed & sub.metrics)
+        {
+            publish_analytics(sub.hdl, update_instrument_, changed & sub.metrics);
+        }
+    }
+}
+
+void WebSocketServer::sample_clock()
+{
+    AllocStats::name_thread("clock_sync");
+
+    while (true)
+    {
+        try
+        {
+            web::json::value request = web::json::value::object();
+            request[U("jsonrpc")] = web::json::value::string(U("2.0"));
+            request[U("method")] = web::json::value::string(U("public/get_time"));
+            request[U("params")] = web::json::value::object();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                // Drop requests whose responses never arrived
+                if (pending_time_requests_.size() >= MAX_PENDING_TIME_REQUESTS)
+                {
+                    pending_time_requests_.clear();
+                }
+
+                int64_t id = next_time_request_id_++;
+                request[U("id")] = web::json::value::number(id);
+                pending_time_requests_[id] = ClockSync::now_us();
+            }
+
+            // The response is picked up by the reader thread
+            deribit_client_.send_message(request);
+        }
+        catch (const std::exception &e)
+        {
+            spdlog::error("Error sampling exchange clock: {}", e.what());
+        }
+
+        std::this_thread::sleep_for(CLOCK_SYNC_INTERVAL);
+    }
+}
+
+bool WebSocketServer::handle_time_response(const web::json::value &update, int64_t arrival_us)
+{
+    if (!update.has_field(U("id")) || !update.at(U("id")).is_number() || !update.has_field(U("result")))
+    {
+        return false;
+    }
+
+    auto it = pending_time_requests_.find(update.at(U("id")).as_number().to_int64());
+    if (it == pending_time_requests_.end())
+    {
+        return false;
+    }
+    int64_t sent_us = it->second;
+    pending_time_requests_.erase(it);
+
+    // usIn / usOut are the exchange receive and send times, the millisecond result is the fallback
+    int64_t server_us = update.at(U("result")).as_number().to_int64() * 1000;
+    int64_t exchange_in_us = update.has_field(U("usIn")) ? update.at(U("usIn")).as_number().to_int64() : server_us;
+    int64_t exchange_out_us = update.has_field(U("usOut")) ? update.at(U("usOut")).as_number().to_int64() : server_us;
+
+    clock_sync_.add_sample(sent_us, exchange_in_us, exchange_out_us, arrival_us);
+    return true;
+}
+
+bool WebSocketServer::record_feed_delay(const web::json::value &update, int64_t arrival_us)
+{
+    if (!clock_sync_.synced() || !update.has_field(U("params")) || !update.at(U("params")).has_field(U("channel")))
+    {
+        return true;
+    }
+
+    const web::json::value &params = update.at(U("params"));
+    const std::string &channel = params.at(U("channel")).as_string();
+    const web::json::value &data = params.at(U("data"));
+
+    // Trade notifications carry a batch of trades, measure against the newest one
+    int64_t timestamp_ms = 0;
+    if (data.is_array())
+    {
+        for (const auto &trade : data.as_array())
+        {
+            if (trade.has_field(U("timestamp")))
+            {
+                timestamp_ms = std::max(timestamp_ms, trade.at(U("timestamp")).as_number().to_int64());
+            }
+        }
+    }
+    else if (data.has_field(U("timestamp")))
+    {
+        timestamp_ms = data.at(U("timestamp")).as_number().to_int64();
+    }
+
+    if (timestamp_ms == 0)
+    {
+        return true;
+    }
+
+    int64_t delay_us = arrival_us - clock_sync_.to_local_us(timestamp_ms * 1000);
+    feed_delay_[channel].record(delay_us);
+
+    // Only untyped grouped snapshots can be dropped without losing state. A raw channel sends its
+    // snapshot once and applies every later change on top of it, so neither may be dropped.
+    bool grouped = !data.has_field(U("type"));
+    if (channel.compare(0, 5, "book.") == 0 && grouped && stale_book_us_ > 0 && delay_us > stale_book_us_)
+    {
+        if (stale_books_++ == 0)
+        {
+            spdlog::warn("Dropping stale book update on {}: {} us old", channel, delay_us);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+web::json::value WebSocketServer::collect_stats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    web::json::value stats = web::json::value::object();
+    stats[U("alloc")] = AllocStats::to_json();
+    stats[U("alloc")][U("analytics_steady_state_allocations")] = web::json::value::number(steady_state_allocations_);
+    stats[U("updates_processed")] = web::json::value::number(updates_processed_);
+
+    stats[U("clock")] = clock_sync_.to_json();
+    web::json::value feed_delay = web::json::value::object();
+    for (const auto &entry : feed_delay_)
+    {
+        feed_delay[U(entry.first)] = entry.second.to_json();
+    }
+    stats[U("feed_delay")] = feed_delay;
+    stats[U("stale_books")] = web::json::value::number(stale_books_);
+
+    // Rates are since the first frame sent, compressed sizes are what went on the wire
+    double elapsed_s = fanout_start_us_ ? (ClockSync::now_us() - fanout_start_us_) / 1e6 : 0.0;
+    web::json::value fanout = web::json::value::object();
+    fanout[U("frames_sent")] = web::json::value::number(frames_sent_);
+    fanout[U("updates_sent")] = web::json::value::number(updates_sent_);
+    fanout[U("uncompressed_payload_bytes")] = web::json::value::number(uncompressed_payload_bytes_);
+    fanout[U("updates_per_second")] = web::json::value::number(elapsed_s > 0 ? updates_sent_ / elapsed_s : 0.0);
+    fanout[U("uncompressed_bytes_per_update")] = web::json::value::number(updates_sent_ ? static_cast<double>(uncompressed_payload_bytes_) / updates_sent_ : 0.0);
+    fanout[U("compressed_payload_bytes")] = web::json::value::number(compressed_payload_bytes_);
+    fanout[U("compressed_bytes_per_update")] = web::json::value::number(updates_sent_ ? static_cast<double>(compressed_payload_bytes_) / updates_sent_ : 0.0);
+    fanout[U("updates_per_frame")] = web::json::value::number(frames_sent_ ? static_cast<double>(updates_sent_) / frames_sent_ : 0.0);
+
+    uint64_t deflate_connections = 0, batched_connections = 0;
+    for (const auto &entry : connection_state_)
+    {
+        deflate_connections += entry.second.deflate;
+        batched_connections += entry.second.batch_ms > 0;
+    }
+    fanout[U("connections")] = web::json::value::number(static_cast<uint64_t>(connection_state_.size()));
+    fanout[U("deflate_connections")] = web::json::value::number(deflate_connections);
+    fanout[U("batched_connections")] = web::json::value::number(batched_connections);
+    stats[U("fanout")] = fanout;
+    return stats;
+}
+
+uint32_t WebSocketServer::update_analytics(const web::json::value &update, std::string &instrument)
+{
+    instrument.clear();
+
+    if (!update.has_field(U("params")) || !update.at(U("params")).has_field(U("channel")))
+    {
+        return 0;
+    }
+
+    const web::json::value &params = update.at(U("params"));
+    const std::string &channel = params.at(U("channel")).as_string();
+    const web::json::value &data = params.at(U("data"));
+
+    // Channel names have the form "<kind>.<instrument>.<options>"
+    auto first_dot = channel.find('.');
+    auto second_dot = channel.find('.', first_dot + 1);
+    if (first_dot == std::string::npos || second_dot == std::string::npos)
+    {
+        return 0;
+    }
+    // Assigned in place so the caller's buffer is reused across updates
+    instrument.assign(channel, first_dot + 1, second_dot - first_dot - 1);
 
-                        spdlog::info("Received update from Deribit: {}", update.serialize());
+    auto it = analytics_.find(instrument);
+    if (it == analytics_.end())
+    {
+        AllocStats::Scope setup(AllocStats::Region::ANALYTICS);
+        it = analytics_.emplace(instrument, BookAnalytics()).first;
+        setup_allocations_ += setup.allocations();
+    }
+    BookAnalytics &analytics = it->second;
 
-                        // Forward the update to the WebSocket client
-                        std::lock_guard<std::mutex> lock(mutex_); // Ensure thread safety
-                        m_server.send(hdl, update.serialize(), websocketpp::frame::opcode::text);
+    if (channel.compare(0, first_dot, "book") == 0)
+    {
+        const std::pair<const char *, BookAnalytics::Side> sides[] = {{"bids", BookAnalytics::Side::Bid},
+                                                                      {"asks", BookAnalytics::Side::Ask}};
+
+        // Raw channels tag each notification "snapshot" or "change" and send [action, price, amount]
+        // levels, grouped channels send untyped [price, amount] snapshots of the top levels
+        bool deltas = data.has_field(U("type"));
+        bool snapshot = !deltas || data.at(U("type")).as_string() == "snapshot";
+
+        for (const auto &side : sides)
+        {
+            if (!data.has_field(U(side.first)))
+            {
+                continue;
+            }
+            const web::json::array &levels = data.at(U(side.first)).as_array();
+
+            // A snapshot replaces the side, an empty side in a change message leaves it untouched
+            if (snapshot)
+            {
+                level_prices_.clear();
+                level_amounts_.clear();
+                if (!deltas)
+                {
+                    for (const auto &level : levels)
+                    {
+                        level_prices_.push_back(level.at(0).as_double());
+                        level_amounts_.push_back(level.at(1).as_double());
                     }
                 }
-                catch (const std::exception &e)
+                analytics.apply_snapshot(side.second, level_prices_.data(), level_amounts_.data(), level_prices_.size());
+            }
+            if (deltas)
+            {
+                for (const auto &level : levels)
                 {
-                    spdlog::error("Error while forwarding updates to client: {}", e.what());
-                } })
-                .detach(); // Detach thread to handle updates independently
+                    double amount = level.at(0).as_string() == "delete" ? 0.0 : level.at(2).as_double();
+                    analytics.apply_change(side.second, level.at(1).as_double(), amount);
+                }
+            }
+        }
+        uint32_t changed = analytics.finish_update();
+
+        // Book updates also age the trade window, so VWAP and flow do not go stale between trades
+        if (data.has_field(U("timestamp")))
+        {
+            changed |= analytics.expire_trades(data.at(U("timestamp")).as_number().to_int64());
+        }
+        return changed;
+    }
+
+    if (channel.compare(0, first_dot, "trades") == 0 && data.is_array())
+    {
+        {
+            AllocStats::Scope setup(AllocStats::Region::ANALYTICS);
+            analytics.reserve_trades();
+            setup_allocations_ += setup.allocations();
+        }
+
+        uint32_t changed = 0;
+        for (const auto &trade : data.as_array())
+        {
+            changed |= analytics.add_trade(trade.at(U("timestamp")).as_number().to_int64(),
+                                           trade.at(U("price")).as_double(),
+                                           trade.at(U("amount")).as_double(),
+                                           trade.at(U("direction")).as_string() == "buy");
+        }
+        return changed;
+    }
+
+    return 0;
+}
+
+void WebSocketServer::publish_analytics(websocketpp::connection_hdl hdl, const std::string &instrument, uint32_t metrics)
+{
+    const BookAnalytics &analytics = analytics_.at(instrument);
+
+    for (uint32_t bit = 1; bit <= metrics; bit <<= 1)
+    {
+        if (!(metrics & bit))
+        {
+            continue;
+        }
+
+        // Compact frame: {"channel":"analytics.<metric>.<instrument>","v":<value>}
+        auto metric = static_cast<BookAnalytics::Metric>(bit);
+        double value = analytics.value(metric);
+
+        frame_buffer_.clear();
+        if (std::isnan(value))
+        {
+            fmt::format_to(std::back_inserter(frame_buffer_), "{{\"channel\":\"analytics.{}.{}\",\"v\":null}}",
+                           BookAnalytics::metric_name(metric), instrument);
         }
         else
         {
-            spdlog::warn("Unsupported action: {}", json_message[U("action")].as_string());
-            m_server.send(hdl, "Unsupported action", websocketpp::frame::opcode::text);
+            fmt::format_to(std::back_inserter(frame_buffer_), "{{\"channel\":\"analytics.{}.{}\",\"v\":{}}}",
+                           BookAnalytics::metric_name(metric), instrument, value);
+        }
+
+        send_update(hdl, frame_buffer_.data(), frame_buffer_.size());
+    }
+}
+
+void WebSocketServer::send_update(websocketpp::connection_hdl hdl, const char *data, std::size_t size)
+{
+    auto it = connection_state_.find(hdl);
+    if (it == connection_state_.end())
+    {
+        return;
+    }
+    ConnectionState &state = it->second;
+
+    if (state.batch_ms == 0)
+    {
+        websocketpp::lib::error_code ec;
+        uint64_t compressed_before = compressed_bytes_on_thread();
+        m_server.send(hdl, data, size, websocketpp::frame::opcode::text, ec);
+        if (ec)
+        {
+            spdlog::warn("Error sending update to client: {}", ec.message());
+            return;
         }
+        record_frame(state, 1, size, compressed_before);
+        return;
     }
-    catch (const std::exception &e)
+
+    // Coalesce updates into one JSON array frame, the first update of a batch arms the flush timer
+    state.batch.push_back(state.batched_updates == 0 ? '[' : ',');
+    state.batch.append(data, size);
+    ++state.batched_updates;
+
+    if (state.batch.size() >= MAX_BATCH_BYTES)
     {
-        spdlog::error("Error processing message: {}", e.what());
-        m_server.send(hdl, "Error processing your request", websocketpp::frame::opcode::text);
+        flush_batch(hdl);
+    }
+    else if (state.batched_updates == 1)
+    {
+        m_server.set_timer(state.batch_ms, websocketpp::lib::bind(
+                                               &WebSocketServer::on_batch_timer, this, hdl, state.batch_generation,
+                                               websocketpp::lib::placeholders::_1));
+    }
+}
+
+void WebSocketServer::flush_batch(websocketpp::connection_hdl hdl)
+{
+    auto it = connection_state_.find(hdl);
+    if (it == connection_state_.end() || it->second.batched_updates == 0)
+    {
+        return;
+    }
+    ConnectionState &state = it->second;
+
+    state.batch.push_back(']');
+
+    websocketpp::lib::error_code ec;
+    uint64_t compressed_before = compressed_bytes_on_thread();
+    m_server.send(hdl, state.batch.data(), state.batch.size(), websocketpp::frame::opcode::text, ec);
+    if (ec)
+    {
+        spdlog::warn("Error sending batch to client: {}", ec.message());
+    }
+    else
+    {
+        record_frame(state, state.batched_updates, state.batch.size(), compressed_before);
+    }
+
+    // Keep the capacity for the next batch
+    state.batch.clear();
+    state.batched_updates = 0;
+    ++state.batch_generation;
+}
+
+void WebSocketServer::record_frame(const ConnectionState &state, std::size_t updates, std::size_t size, uint64_t compressed_before)
+{
+    if (fanout_start_us_ == 0)
+    {
+        fanout_start_us_ = ClockSync::now_us();
+    }
+    ++frames_sent_;
+    updates_sent_ += updates;
+    uncompressed_payload_bytes_ += size;
+
+    // The frame was compressed inside send() on this thread, connections without deflate send it as is
+    compressed_payload_bytes_ += state.deflate ? compressed_bytes_on_thread() - compressed_before : size;
+}
+
+void WebSocketServer::on_batch_timer(websocketpp::connection_hdl hdl, uint64_t batch_generation, websocketpp::lib::error_code const &ec)
+{
+    if (ec)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // A batch flushed early by size leaves its timer armed, it must not cut the next batch short
+    auto it = connection_state_.find(hdl);
+    if (it == connection_state_.end() || it->second.batch_generation != batch_generation)
+    {
+        return;
     }
+    flush_batch(hdl);
 }
 
 int main()
 {
-    WebSocketServer server;
+    // BATCH_MS sets the default micro-batching window, STALE_BOOK_MS the age after which
+    // book snapshots are dropped
+    const char *batch_ms = std::getenv("BATCH_MS");
+    const char *stale_book_ms = std::getenv("STALE_BOOK_MS");
+    WebSocketServer server(batch_ms ? static_cast<uint32_t>(std::strtoul(batch_ms, nullptr, 10)) : 0,
+                           stale_book_ms ? static_cast<uint32_t>(std::strtoul(stale_book_ms, nullptr, 10)) : 1000);
     uint16_t port = 9002; // You can choose any port
     std::cout << "Starting WebSocket server on port " << port << "..." << std::endl;
     server.run(port);
@@ -0,0 +1,102 @@
+#include "alloc_stats.h"
+#include "book_analytics.h"
+#include "order_request_builder.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Warms up BookAnalytics and OrderRequestBuilder, then requires applying book
+// updates and building order request strings to make no heap allocations.
+// Receiving, parsing and sending are not covered. Built with ALLOC_STATS so
+// the hook is live.
+
+const int WARMUP_ITERATIONS = 100;
+const int CHECKED_ITERATIONS = 10000;
+
+int failures = 0;
+
+void expect_zero(const char *name, uint64_t allocations)
+{
+    if (allocations != 0)
+    {
+        std::cerr << "FAIL: " << name << " made " << allocations << " heap allocations after warm-up" << std::endl;
+        ++failures;
+    }
+    else
+    {
+        std::cout << "ok: " << name << std::endl;
+    }
+}
+
+void apply_book_update(BookAnalytics &analytics, int i, std::vector<double> &prices, std::vector<double> &amounts)
+{
+    // Shift the top levels around so every metric is recomputed
+    for (std::size_t level = 0; level < prices.size(); ++level)
+    {
+        prices[level] = 2500.0 - level * 0.5 - (i % 3) * 0.5;
+        amounts[level] = 1.0 + (i + level) % 7;
+    }
+    analytics.apply_snapshot(BookAnalytics::Side::Bid, prices.data(), amounts.data(), prices.size());
+    analytics.apply_change(BookAnalytics::Side::Ask, 2501.0 + (i % 4) * 0.5, (i % 2) ? 3.0 : 0.0);
+    analytics.apply_change(BookAnalytics::Side::Ask, 2503.0, 1.0 + i % 5);
+    analytics.finish_update();
+    analytics.add_trade(1000LL * i, 2500.5, 1.0 + i % 3, i % 2 == 0);
+}
+
+int main()
+{
+    // A zero count only means something if allocations are being recorded
+    {
+        AllocStats::Scope scope(AllocStats::Region::OTHER);
+        int *volatile probe = new int(1);
+        delete probe;
+        if (!AllocStats::enabled() || scope.allocations() == 0)
+        {
+            std::cerr << "FAIL: allocation hook is not active" << std::endl;
+            return 1;
+        }
+    }
+
+    BookAnalytics analytics;
+    std::vector<double> prices(10), amounts(10);
+    for (int i = 0; i < WARMUP_ITERATIONS; ++i)
+    {
+        apply_book_update(analytics, i, prices, amounts);
+    }
+    {
+        AllocStats::Scope scope(AllocStats::Region::ANALYTICS);
+        for (int i = 0; i < CHECKED_ITERATIONS; ++i)
+        {
+            apply_book_update(analytics, WARMUP_ITERATIONS + i, prices, amounts);
+        }
+        expect_zero("analytics apply", scope.allocations());
+    }
+
+    OrderRequestBuilder builder("api_key", "api_secret");
+    const std::string instrument = "ETH-PERPETUAL", buy = "buy", sell = "sell", order_id = "ETH-123456789";
+    for (int i = 0; i < WARMUP_ITERATIONS; ++i)
+    {
+        builder.place_order(instrument, 10.0 + i, 2500.5 + i, buy, false);
+        builder.place_order(instrument, 10.0 + i, 0.0, sell, true);
+        builder.modify_order(order_id, i, 2400.25 + i);
+        builder.cancel_order(order_id);
+    }
+    {
+        AllocStats::Scope scope(AllocStats::Region::ORDER_BUILD);
+        for (int i = 0; i < CHECKED_ITERATIONS; ++i)
+        {
+            builder.place_order(instrument, 10.0 + i % 100, 2500.5 + i % 100, i % 2 ? buy : sell, i % 3 == 0);
+        }
+        expect_zero("order string build", scope.allocations());
+
+        AllocStats::Scope cancel_scope(AllocStats::Region::ORDER_BUILD);
+        for (int i = 0; i < CHECKED_ITERATIONS; ++i)
+        {
+            builder.modify_order(order_id, i % 100, 2400.25 + i % 100);
+            builder.cancel_order(order_id);
+        }
+        expect_zero("modify and cancel string build", cancel_scope.allocations());
+    }
+
+    return failures == 0 ? 0 : 1;
+}